@@ -1,10 +1,102 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
+
 #include "adc2.h"
 
 // static class variables must be declared so that space can be allocated for them
 static adc2::VoltageReference adc2::voltageReference = adc2::Reference_AVcc;
 static adc2::ClockPrescaler adc2::clockPrescaler = adc2::Prescale_64;
 
+// the arduino core counts timer/counter 0 overflows here (wiring.c), timer 0 runs at F_CPU/64
+extern volatile unsigned long timer0_overflow_count;
+
+// burst mode state, the values read outside the ISR are changed by it and thus must be declared "static volatile"
+// the rest are only touched by the ISR once startBurst enables it, so they are left non-volatile to keep the ISR short
+// the access functions only read the multibyte values once the state is Burst_done, at which point
+// the ISR is disabled and no longer writes them, so no atomic block is needed
+enum BurstState { Burst_idle=0, Burst_armed, Burst_capturing, Burst_done };
+static volatile unsigned char  burstState = Burst_idle;
+static unsigned char*          burstBuffer;         // caller supplied, filled in place
+static unsigned int            burstLength;
+static unsigned int            burstPreTrigger;     // samples to keep from before the trigger
+static unsigned char           burstTriggerEdge;
+static unsigned char           burstThreshold;
+static unsigned char           burstPrescaler;
+static unsigned char           burstDiscard;        // conversions still to throw away after starting
+static unsigned char           burstPrevious;       // previous sample, used for the threshold crossing test
+static volatile unsigned int   burstWriteIndex;     // next buffer slot, equals the oldest sample once done
+static unsigned int            burstRemaining;      // pre-trigger samples still to fill while armed, then samples still to store
+static volatile unsigned int   burstStartTicks;     // timer 0 ticks at the trigger sample
+static volatile unsigned int   burstEndTicks;       // timer 0 ticks at the last sample
+
+// latch timer 0 as 16 bits (low byte of the overflow count and TCNT0) without calling micros()
+// a call in the ISR would make it save every call-clobbered register on every sample
+// this wraps every 65536 ticks, i.e. 262 msec with a 16 mhz clock
+static inline unsigned int readTimer0Ticks()
+{
+  unsigned char overflows = *(volatile unsigned char*) &timer0_overflow_count;  // low byte only
+  unsigned char ticks = TCNT0;
+
+  // inside an ISR the overflow interrupt may be pending and not yet counted (same correction as micros())
+  if ( ( (1<<TOV0) & TIFR0 ) && ticks < 255 )
+    overflows++;
+  return ( (unsigned int) overflows << 8 ) | ticks;
+}
+
+// this ISR stores one left-adjusted 8-bit sample per free-running conversion
+// it is kept short since at Prescale_16 a new conversion completes every 208 CPU clocks
+ISR( ADC_vect )
+{
+  unsigned char sample = ADCH;
+
+  if ( burstDiscard )
+  {
+    burstDiscard--;
+    burstPrevious = sample;
+    return;
+  }
+
+  unsigned int index = burstWriteIndex;
+  burstBuffer[index] = sample;
+  if ( ++index == burstLength )
+    index = 0;
+  burstWriteIndex = index;
+
+  if ( Burst_armed == burstState )
+  {
+    unsigned char previous = burstPrevious;
+    burstPrevious = sample;
+
+    // only look for the trigger once the pre-trigger window has been filled
+    if ( burstRemaining )
+    {
+      burstRemaining--;
+      return;
+    }
+
+    unsigned char edge = burstTriggerEdge;
+    if ( adc2::Trigger_none == edge
+      || ( adc2::Trigger_rising == edge ? ( previous < burstThreshold && sample >= burstThreshold )
+                                        : ( previous > burstThreshold && sample <= burstThreshold ) ) )
+    {
+      // the trigger sample counts as the first post-trigger sample, timing is measured from here
+      burstStartTicks = readTimer0Ticks();
+      burstState = Burst_capturing;
+      burstRemaining = burstLength - burstPreTrigger;
+    }
+    else
+      return;
+  }
+
+  if ( !--burstRemaining )
+  {
+    // stop free-running and the interrupt, the buffer now holds the burst starting at burstWriteIndex
+    ADCSRA &= ~( (1<<ADATE) | (1<<ADIE) );
+    burstEndTicks = readTimer0Ticks();
+    burstState = Burst_done;
+  }
+}
+
 // values set with these configuration calls are used within startAutotrigger and readSynchronous
 static void adc2::setClockPrescaler( adc2::ClockPrescaler clockPrescaler )
 {
@@ -19,7 +111,7 @@ static void adc2::setVoltageReference( adc2::VoltageReference voltageReference )
 // start autoTrigger mode
 static void adc2::startAutotrigger( adc2::AnalogSource analogSource )
 {
-  adc2::startConversion( analogSource, true );
+  adc2::startConversion( analogSource, true, adc2::clockPrescaler, false );
   adc2::blockTillConversionDone();
 }
 
@@ -32,27 +124,140 @@ static int adc2::reread()
 // sets up the conversion, waits till the answer is ready and returns it
 static int adc2::readSynchronous(adc2::AnalogSource analogSource)
 {
-  adc2::startConversion( analogSource, false );
+  adc2::startConversion( analogSource, false, adc2::clockPrescaler, false );
   adc2::blockTillConversionDone();
   return adc2::readConversionResult();
 }
 
+// start a burst capture, the ADC ISR fills the buffer and isBurstDone reports when it is full
+static void adc2::startBurst( adc2::AnalogSource analogSource, unsigned char* buffer, unsigned int length,
+	adc2::TriggerEdge triggerEdge, unsigned char threshold, unsigned int preTriggerSamples, adc2::ClockPrescaler prescaler )
+{
+  // make sure a previous burst (or autotrigger session) is not still running
+  adc2::stopBurst();
+
+  // a zero length or missing buffer leaves no burst (address 0 is the register file, so never write through it)
+  if ( !length || !buffer )
+  {
+    burstState = Burst_idle;
+    return;
+  }
+  if ( preTriggerSamples >= length )
+    preTriggerSamples = length - 1;
+
+  // the ISR is disabled at this point so no atomic block is needed
+  burstBuffer = buffer;
+  burstLength = length;
+  burstPreTrigger = ( Trigger_none == triggerEdge ) ? 0 : preTriggerSamples;
+  burstTriggerEdge = triggerEdge;
+  burstThreshold = threshold;
+  burstPrescaler = prescaler;
+  burstDiscard = 2;
+  burstWriteIndex = 0;
+  burstRemaining = burstPreTrigger;
+  burstStartTicks = burstEndTicks = 0;
+  burstState = Burst_armed;   // with Trigger_none the first stored sample is the trigger
+
+  // the ISR state above is not volatile, so make sure its stores are not moved past enabling the interrupt
+  __asm__ __volatile__ ( "" ::: "memory" );
+
+  // free-running, left-adjusted, with the conversion complete interrupt enabled
+  adc2::startConversion( analogSource, true, prescaler, true );
+}
+
+// stop the conversions and the ISR, the ADC is left enabled
+static void adc2::stopBurst()
+{
+  ADCSRA &= ~( (1<<ADATE) | (1<<ADIE) );
+  if ( Burst_done != burstState )
+    burstState = Burst_idle;
+}
+
+static bool adc2::isBurstDone()
+{
+  if ( Burst_done != burstState )
+    return false;
+
+  // the buffer is not volatile, so keep the compiler from moving the caller's buffer reads above the state check
+  __asm__ __volatile__ ( "" ::: "memory" );
+  return true;
+}
+
+// once done the ISR no longer touches burstWriteIndex, so it can be read without an atomic block
+static unsigned int adc2::getBurstStartIndex()
+{
+  return adc2::isBurstDone() ? burstWriteIndex : 0;
+}
+
+// measured time from the trigger sample to the last sample in usec (0 if there is nothing to measure)
+static float burstElapsedMicroseconds()
+{
+  if ( !adc2::isBurstDone() || burstLength - burstPreTrigger < 2 )
+    return 0.0;
+
+  unsigned int ticks = burstEndTicks - burstStartTicks;
+  return ticks * 64.0 / ( F_CPU / 1000000.0 );
+}
+
+// measured rate over the samples from the trigger to the end of the burst (the pre-trigger samples are not timed)
+static float adc2::getBurstSamplesPerSecond()
+{
+  float elapsed = burstElapsedMicroseconds();
+  if ( elapsed <= 0.0 )
+    return 0.0;
+  return 1000000.0 * ( burstLength - burstPreTrigger - 1 ) / elapsed;
+}
+
+// measured duration minus nominal duration in usec (see the header for its uncertainty)
+static long adc2::getBurstTimingError()
+{
+  float elapsed = burstElapsedMicroseconds();
+  if ( elapsed <= 0.0 )
+    return 0;
+
+  float nominal = 1000000.0 * ( burstLength - burstPreTrigger - 1 ) / adc2::calcBurstSamplesPerSecond( (adc2::ClockPrescaler) burstPrescaler );
+  return (long) ( elapsed - nominal );
+}
+
+// the timing error expressed in conversion periods, rounded to the nearest whole conversion
+static int adc2::getBurstDroppedConversions()
+{
+  float period = 1000000.0 / adc2::calcBurstSamplesPerSecond( (adc2::ClockPrescaler) burstPrescaler );
+  float dropped = adc2::getBurstTimingError() / period;
+  return (int) ( dropped < 0.0 ? dropped - 0.5 : dropped + 0.5 );
+}
+
+// plus/minus conversions of noise in getBurstDroppedConversions when nothing was dropped:
+// one timer 0 tick (64 CPU clocks) of quantization plus up to ~80 CPU clocks when the core's TIMER0_OVF ISR delays an end
+static float adc2::calcBurstDropUncertainty( adc2::ClockPrescaler prescaler )
+{
+  return ( 64 + 80 ) / ( 13.0 * ( 1 << prescaler ) );
+}
+
+// each free-running conversion takes 13 ADC clocks and the ADC clock is F_CPU / 2^prescaler
+static float adc2::calcBurstSamplesPerSecond( adc2::ClockPrescaler prescaler )
+{
+  return (float) F_CPU / ( 13 * ( 1 << prescaler ) );
+}
+
 // resets the ADC sub-system registers to the power-on-default state
 static void adc2::reset()
 {
-  ADCSRA = 0; // zero this one first
+  ADCSRA = 0; // zero this one first (also stops a running burst before its state is cleared)
+  burstState = Burst_idle;
   ADMUX = ADCSRB = DIDR0 = ADCH = ADCL = 0; 
 }
 
 // -------------------------private class functions-----------------------------
 
-static void adc2::startConversion( adc2::AnalogSource analogSource, bool autoTrigger )
+// burstMode sets ADLAR (8-bit result in ADCH) and enables the ADC interrupt, it is only used by startBurst
+static void adc2::startConversion( adc2::AnalogSource analogSource, bool autoTrigger, adc2::ClockPrescaler prescaler, bool burstMode )
 {
   // power up the ADC sub-system by writing 0 in PRR.PRADC
   PRR &= ~ (1<<PRADC);
 
-  // set the voltage reference (high two bits) and measurement source (bottom 3 bits)
-  ADMUX = (adc2::voltageReference << 6) | analogSource ;
+  // set the voltage reference (high two bits), left adjust for burst mode and measurement source (bottom 3 bits)
+  ADMUX = (adc2::voltageReference << 6) | (burstMode ? (1<<ADLAR) : 0) | analogSource ;
 
   // if we use auto-trigger, the mode will be "free-running"
   ADCSRB = 0;
@@ -66,10 +271,11 @@ static void adc2::startConversion( adc2::AnalogSource analogSource, bool autoTri
     ADCSRA |= (1<<ADIF);
 
   // initiate the conversion
-  ADCSRA = (1<<ADEN) | (1<<ADSC) | (autoTrigger ? (1<<ADATE) : 0) | adc2::clockPrescaler;
+  ADCSRA = (1<<ADEN) | (1<<ADSC) | (autoTrigger ? (1<<ADATE) : 0) | (burstMode ? (1<<ADIE) : 0) | prescaler;
 
   // note that the ADSC bit in this register will be 1 while the conversion is in progress and 0 when it is done
-  // in the case of autotrigger it will stay 1 after startAutotrigger returns (since we are not using an ADC ISR) 
+  // in the case of autotrigger it will stay 1 after startAutotrigger returns (the ADC ISR is only enabled for burst mode,
+  // autotrigger and synchronous modes poll the registers instead)
 }
 
 static int adc2::readConversionResult()
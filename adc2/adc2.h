@@ -3,7 +3,7 @@
 /*
  this exposes the ATMega328 ADC sub-system
 
-there are two modes of operation: autotrigger and synchronous
+there are three modes of operation: autotrigger, synchronous and burst
 
 autotrigger mode is non-blocking
   first call startAutotrigger to configures the sub-system to auto-measure from the analog source
@@ -13,6 +13,16 @@ autotrigger mode is non-blocking
 synchronous mode is blocking
   the readSynchronous function initialtes the specified measurement and does not return until the measurement is ready
 
+burst mode is non-blocking and is intended for capturing waveforms (e.g. current transients, fan motor signals)
+  call startBurst with a caller supplied buffer, the ADC ISR fills the buffer at the full free-running conversion rate
+  then poll isBurstDone, when it returns true the buffer holds the waveform in place (nothing is copied)
+  only the high 8 bits of each measurement are kept (ADLAR left-adjusted result) so the ISR reads ADCH only
+  optionally the capture can be armed to start on a threshold crossing and keep a window of pre-trigger samples
+    in that case the buffer is used as a ring and the oldest sample is at getBurstStartIndex (i.e. buffer[(start+i) % length])
+  this package owns the ADC interrupt: it implements ISR(ADC_vect) for burst mode, so sketches using adc2 can not define their own
+  startBurst stops any autotrigger session and leaves ADLAR set, so reread returns left-adjusted garbage after a burst
+    until startAutotrigger or readSynchronous is called again
+
 the ATMega328 has a few measurement gotchas:
 
   the first couple of measurements after starting a new source appear to not be very accurate.  
@@ -22,6 +32,8 @@ the ATMega328 has a few measurement gotchas:
 
   effetive resolution appears to drop off at higher ADC clock rates.  an ADC clock rate of 250 mhz or lower is recommended and 1 mhz is maximum.  
     with a 16mhz CPU clock these values are realized using prescale_64 (default) and prescale_16, respectively
+    burst mode only keeps 8 bits so it can run faster, prescale_16 (~76900 samples/sec at 16mhz) is its default
+    faster prescalers have not been cycle counted against the ISR and may drop conversions, see getBurstDroppedConversions
 
 */
 
@@ -31,6 +43,7 @@ class adc2 {
     enum AnalogSource { ADC0=0, ADC1, ADC2, ADC3, ADC4, ADC5, ADC6, ADC7, Temperature_sensor, V_1_1=14, Gnd=15 };
     enum ClockPrescaler { Prescale_2=1, Prescale_4, Prescale_8, Prescale_16, Prescale_32, Prescale_64, Prescale_128 };
     enum VoltageReference { Reference_AREF=0, Reference_AVcc, Reference_1_1_v=3 };
+    enum TriggerEdge { Trigger_none=0, Trigger_rising, Trigger_falling };
  
     static void setClockPrescaler( adc2::ClockPrescaler clockPrescaler );  	// if not otherwise specified, the default is Prescale_64
     static void setVoltageReference( adc2::VoltageReference voltageReference ); // if not otherwise specified, the default is AVcc
@@ -46,6 +59,31 @@ class adc2 {
     // note: the first read or two after starting or switching analog source appear to be invalid, after that repeated reads from the same source appear valid
      static int readSynchronous(adc2::AnalogSource analogSource );
 
+    // starts a burst capture of length 8-bit samples into buffer (non-blocking, the ADC ISR does the work)
+    // with Trigger_none the capture starts right away, otherwise it waits for the signal to cross threshold
+    // and keeps preTriggerSamples from before the crossing.  the buffer must stay valid until the burst is done or stopped
+    // note: the first two conversions are discarded (see the gotchas above) and global interrupts must be enabled
+    static void startBurst( adc2::AnalogSource analogSource, unsigned char* buffer, unsigned int length,
+                            adc2::TriggerEdge triggerEdge = adc2::Trigger_none, unsigned char threshold = 128,
+                            unsigned int preTriggerSamples = 0, adc2::ClockPrescaler prescaler = adc2::Prescale_16 );
+    static void stopBurst();                  // abandons a burst in progress (e.g. the trigger never came)
+    static bool isBurstDone();                // true once the buffer is full
+    static unsigned int getBurstStartIndex(); // index of the oldest sample in the buffer (0 unless a pre-trigger window was used)
+
+    // timing of the most recent completed burst, measured from the trigger sample to the last sample (0 if none)
+    // conversions are paced by the ADC clock, not by the ISR, so samples are evenly spaced (per-sample jitter is not measured)
+    // unless the ISR falls behind and a conversion is dropped.  getBurstTimingError is the measured duration minus the
+    // nominal duration in usec and getBurstDroppedConversions is that error in conversion periods.  the measurement has
+    // about +/- 9 usec of noise at 16 mhz (one timer 0 tick of quantization plus the core's TIMER0_OVF ISR), so an isolated
+    // drop is not reliably detected.  only trust an estimate well beyond calcBurstDropUncertainty, which at faster
+    // prescalers means many dropped conversions (prescale_16 is about +/- 0.7, prescale_2 about +/- 5.5)
+    // timing uses the arduino core's timer 0 directly and wraps for bursts longer than 262 msec (at 16 mhz)
+    static float getBurstSamplesPerSecond();
+    static long getBurstTimingError();
+    static int getBurstDroppedConversions();
+    static float calcBurstDropUncertainty( adc2::ClockPrescaler prescaler );  // +/- conversions of measurement noise
+    static float calcBurstSamplesPerSecond( adc2::ClockPrescaler prescaler ); // nominal rate: F_CPU / (prescale * 13)
+
     // resets the sub-system registers to the power-on-default values
     static void reset();
 
@@ -55,7 +93,7 @@ class adc2 {
 
     // a different usage mode is to call startConversion with autoTrigger=true and then use readConversionResult repeatedly with no intervening calls to startConversion.
     // after the first conversion, readConversionResult will return immediately with the most recent measurement (i.e. no blocking)
-    static void startConversion( adc2::AnalogSource analogSource, bool autoTrigger );
+    static void startConversion( adc2::AnalogSource analogSource, bool autoTrigger, adc2::ClockPrescaler prescaler, bool burstMode );
     static void blockTillConversionDone();
     static int readConversionResult(); 
  